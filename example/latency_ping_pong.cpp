@@ -0,0 +1,79 @@
+//
+// Created by agent on 19.10.26.
+//
+#include "simple_sockets.hpp"
+#include <fmt/base.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+// Measures round trip latency of small messages over loopback, optionally with busy polling enabled
+// on both ends. Compare e.g. `latency_ping_pong 12345` with `latency_ping_pong 12345 50 2 3`.
+// Server and client workers spin, so give them distinct cores, apart from the core running main.
+int main(int argc, const char *argv[]) {
+    if (argc < 2) {
+        fmt::println("usage: latency_ping_pong <port> [spin budget us] [server core] [client core]");
+        return -1;
+    }
+    auto const port = static_cast<std::uint16_t>(std::stoi(argv[1]));
+    simple::BusyPollOptions server_busy_poll{};
+    if (argc > 2) {
+        server_busy_poll.spin_budget = std::chrono::microseconds{std::stoi(argv[2])};
+    }
+    auto client_busy_poll = server_busy_poll;
+    if (argc > 3) {
+        server_busy_poll.cpu_core = static_cast<unsigned>(std::stoi(argv[3]));
+    }
+    if (argc > 4) {
+        client_busy_poll.cpu_core = static_cast<unsigned>(std::stoi(argv[4]));
+    }
+    if (server_busy_poll.cpu_core.has_value() && server_busy_poll.cpu_core == client_busy_poll.cpu_core) {
+        fmt::println("server and client workers must not share a core");
+        return -1;
+    }
+
+    constexpr std::size_t rounds = 10000;
+    auto server = simple::Sockets::create_server(port, simple::ServerSocket::blocking::blocking, 1000ms);
+    std::optional<simple::Client> served;
+    std::jthread acceptor{[&]() {
+        while (!served) {
+            try {
+                served.emplace(server.accept([](std::vector<char> const &request) { return request; }, server_busy_poll));
+            } catch (simple::SocketTimeoutError const &) {
+                continue;
+            }
+        }
+    }};
+
+    std::atomic<std::size_t> received{0};
+    auto client = simple::Sockets::create_client("localhost", port,
+                                                 [&](std::vector<char> const &response) -> std::vector<char> {
+                                                     received += response.size();
+                                                     return {};
+                                                 }, client_busy_poll);
+    acceptor.join();
+
+    std::vector<double> latencies;
+    latencies.reserve(rounds);
+    for (std::size_t i = 0; i < rounds; ++i) {
+        auto const expected = received + 1;
+        auto const start = std::chrono::steady_clock::now();
+        client.send("x");
+        while (received < expected) {
+            // spin, any sleep here would dominate the measurement
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    std::ranges::sort(latencies);
+    auto const percentile = [&](double p) { return latencies[static_cast<std::size_t>(p * (latencies.size() - 1))]; };
+    fmt::println("round trip us: p50 {:.1f} p99 {:.1f} p99.9 {:.1f} max {:.1f}",
+                 percentile(0.5), percentile(0.99), percentile(0.999), latencies.back());
+    return 0;
+}
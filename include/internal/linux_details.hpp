@@ -10,6 +10,8 @@
 #include <sys/poll.h>
 #include <netdb.h>
 #include <arpa/inet.h>
+#include <pthread.h>
+#include <sched.h>
 using socket_t = int;
 
 #endif //SIMPLESOCKET_LINUX_DETAILS_HPP
@@ -0,0 +1,53 @@
+//
+// Created by agent on 19.10.26.
+//
+
+#ifndef SIMPLESOCKET_SIMPLE_RPC_CLIENT_HPP
+#define SIMPLESOCKET_SIMPLE_RPC_CLIENT_HPP
+
+#include <cstddef>
+#include <future>
+#include <memory>
+#include "simple_socket.hpp"
+
+namespace simple {
+    // Frames exchanged by RpcClient and rpc_handler:
+    //   [payload length: u32 big endian][correlation id: u64 big endian][payload]
+    // A response carries the correlation id of its request and may arrive in any order.
+
+    using RpcHandler = std::function<std::vector<char>(std::vector<char> const &request)>;
+
+    // Adapts a request/response handler to a framed server side receive callback. The callback may be
+    // reused across accept calls, each connection decodes its frames independently. A SocketError thrown
+    // by the handler closes the connection, failing the client's outstanding requests.
+    [[nodiscard]] Client::ReceiveCallback rpc_handler(RpcHandler handler);
+
+    class RpcClient {
+        friend class Sockets;
+    public:
+        RpcClient(RpcClient &&) noexcept = default;
+        RpcClient &operator=(RpcClient &&) noexcept = default;
+        ~RpcClient() = default;
+
+        // Blocks while max_in_flight requests are outstanding. The future holds a SocketShutdownError
+        // if the connection closes before the response arrives.
+        [[nodiscard]] std::future<std::vector<char>> call(std::string_view const request);
+        [[nodiscard]] std::future<std::vector<char>> call(std::vector<char> const &request);
+
+        [[nodiscard]] std::size_t in_flight() const;
+        [[nodiscard]] bool is_open() const;
+        void close();
+
+        Peer const &getPeer() const;
+
+    private:
+        RpcClient(std::string const &host, std::uint16_t port, std::size_t max_in_flight,
+                  BusyPollOptions const &busy_poll);
+
+        struct State;
+        // shared with the receive callback of m_client, which is destroyed first
+        std::shared_ptr<State> m_state;
+        Client m_client;
+    };
+}
+#endif //SIMPLESOCKET_SIMPLE_RPC_CLIENT_HPP
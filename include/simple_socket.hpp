@@ -3,11 +3,11 @@
 #include <vector>
 #include <string>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <atomic>
 #include <chrono>
 #include <cstdint>
-#include <thread>
-#include <mutex>
 #include "internal/exceptions.hpp"
 #include "internal/simple_types.hpp"
 #include "internal/unique_value.hpp"
@@ -18,6 +18,14 @@ namespace simple {
         std::uint16_t port;
     };
 
+    // Optional low latency receive mode. The worker spins on non-blocking reads for `spin_budget`
+    // before falling back to a blocking poll.
+    struct BusyPollOptions {
+        std::chrono::microseconds spin_budget{0};       // 0 disables spinning
+        std::chrono::microseconds socket_busy_poll{0};  // SO_BUSY_POLL, 0 leaves the system default
+        std::optional<unsigned> cpu_core;               // pin the receiving worker thread to this core
+    };
+
     class BaseSocket {
     protected:
         using unique_deleter = void(*)(socket_t);
@@ -34,9 +42,13 @@ namespace simple {
         }
     };
 
-    class Client : public BaseSocket {
+    class Connection;
+
+    class Client {
         friend class Sockets;
         friend class ServerSocket;
+        friend class RpcClient;
+        friend class Connection;
     public:
         using ReceiveCallback = std::function<std::vector<char>(std::vector<char> const & request)>;
 
@@ -50,14 +62,17 @@ namespace simple {
         [[nodiscard]] bool is_open() const;
         void close();
 
+        [[nodiscard]] std::optional<socket_t> socket_handle() const;
+
     private:
-        explicit Client(socket_t, ReceiveCallback callback, Peer const &peer);
-        Client(socket_t, Client::ReceiveCallback const &);
-        Client(std::string const &host, std::uint16_t port, ReceiveCallback callback);
+        // invoked on the worker thread once it stops receiving, either on close or because the peer went away
+        using CloseCallback = std::function<void()>;
 
-        std::vector<char> receive() const;
-        std::string receive_string() const;
-        void waiting_for_incoming_message(std::stop_token const&);
+        explicit Client(socket_t, ReceiveCallback callback, Peer const &peer, BusyPollOptions const &busy_poll = {},
+                        CloseCallback on_close = {});
+        Client(socket_t, Client::ReceiveCallback const &);
+        Client(std::string const &host, std::uint16_t port, ReceiveCallback callback,
+               BusyPollOptions const &busy_poll = {}, CloseCallback on_close = {});
 
     private:
         Peer m_peer;
@@ -65,9 +80,9 @@ namespace simple {
         Peer const &getPeer() const;
 
     private:
-        ReceiveCallback m_callback;
-        std::mutex mutable m_mutex;
-        std::jthread m_worker;
+        // connection state and worker thread live behind a stable address,
+        // moving a client only hands over the pointer
+        std::unique_ptr<Connection> m_connection;
     };
 
     class ServerSocket : public BaseSocket {
@@ -82,7 +97,7 @@ namespace simple {
         ServerSocket(ServerSocket &&) noexcept = default;
         ServerSocket& operator=(ServerSocket &&) noexcept = default;
 
-        [[nodiscard]] Client accept(const Client::ReceiveCallback& callback);
+        [[nodiscard]] Client accept(const Client::ReceiveCallback& callback, BusyPollOptions const &busy_poll = {});
         [[nodiscard]] bool is_open() const;
         void close();
 
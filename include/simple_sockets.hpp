@@ -8,6 +8,7 @@
 #include <utility>
 
 #include "simple_socket.hpp"
+#include "simple_rpc_client.hpp"
 
 namespace simple {
     class Sockets final {
@@ -31,6 +32,15 @@ namespace simple {
                 std::string const &host,
                 std::uint16_t port,
                 Client::ReceiveCallback callback,
+                BusyPollOptions const &busy_poll = {},
+                Sockets const & = instance()
+        );
+
+        static RpcClient create_rpc_client(
+                std::string const &host,
+                std::uint16_t port,
+                std::size_t max_in_flight = 64,
+                BusyPollOptions const &busy_poll = {},
                 Sockets const & = instance()
         );
 
@@ -0,0 +1,213 @@
+//
+// Created by agent on 19.10.26.
+//
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include "simple_rpc_client.hpp"
+#include <fmt/format.h>
+
+namespace simple {
+    static constexpr std::size_t FRAME_HEADER_SIZE = sizeof(std::uint32_t) + sizeof(std::uint64_t);
+    static constexpr std::size_t MAX_FRAME_PAYLOAD_SIZE = 64 * 1024 * 1024;
+
+    static void encode_frame(std::vector<char> &out, std::uint64_t id, std::vector<char> const &payload) {
+        if (payload.size() > MAX_FRAME_PAYLOAD_SIZE) {
+            throw SocketError(fmt::format("rpc payload of {} bytes exceeds frame limit", payload.size()));
+        }
+        auto const length = static_cast<std::uint32_t>(payload.size());
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>(length >> shift));
+        }
+        for (int shift = 56; shift >= 0; shift -= 8) {
+            out.push_back(static_cast<char>(id >> shift));
+        }
+        out.insert(out.end(), payload.begin(), payload.end());
+    }
+
+    // Reassembles frames from the byte stream, a frame may be split over several receives.
+    // Malformed input leaves the stream out of sync, so it is reported as a fatal SocketShutdownError.
+    class FrameDecoder {
+    public:
+        template<typename OnFrame>
+        void feed(std::vector<char> const &bytes, OnFrame &&on_frame) {
+            m_buffer.insert(m_buffer.end(), bytes.begin(), bytes.end());
+
+            std::size_t offset{0};
+            try {
+                decode(offset, on_frame);
+            } catch (...) {
+                // frames already handed out must not be decoded again
+                consume(offset);
+                throw;
+            }
+            consume(offset);
+        }
+
+    private:
+        template<typename OnFrame>
+        void decode(std::size_t &offset, OnFrame &on_frame) {
+            while (m_buffer.size() - offset >= FRAME_HEADER_SIZE) {
+                auto const *header = reinterpret_cast<unsigned char const *>(m_buffer.data() + offset);
+                std::uint32_t length{0};
+                for (std::size_t i = 0; i < sizeof(length); ++i) {
+                    length = (length << 8) | header[i];
+                }
+                std::uint64_t id{0};
+                for (std::size_t i = sizeof(length); i < FRAME_HEADER_SIZE; ++i) {
+                    id = (id << 8) | header[i];
+                }
+                if (length > MAX_FRAME_PAYLOAD_SIZE) {
+                    throw SocketShutdownError(fmt::format("rpc frame of {} bytes exceeds frame limit", length));
+                }
+                if (m_buffer.size() - offset - FRAME_HEADER_SIZE < length) {
+                    break;
+                }
+                auto const payload_begin = m_buffer.begin() + static_cast<std::ptrdiff_t>(offset + FRAME_HEADER_SIZE);
+                std::vector<char> payload{payload_begin, payload_begin + length};
+                offset += FRAME_HEADER_SIZE + length;
+                on_frame(id, std::move(payload));
+            }
+        }
+
+        void consume(std::size_t offset) {
+            m_buffer.erase(m_buffer.begin(), m_buffer.begin() + static_cast<std::ptrdiff_t>(offset));
+        }
+
+        std::vector<char> m_buffer;
+    };
+
+    Client::ReceiveCallback rpc_handler(RpcHandler handler) {
+        // the decoder is held by value, every copy of the callback and so every connection reassembles its own stream
+        return [decoder = FrameDecoder{}, handler = std::move(handler)](std::vector<char> const &request) mutable {
+            std::vector<char> responses;
+            decoder.feed(request, [&](std::uint64_t id, std::vector<char> const &payload) {
+                try {
+                    encode_frame(responses, id, handler(payload));
+                } catch (SocketShutdownError const &) {
+                    throw;
+                } catch (SocketError const &e) {
+                    // the request can not be answered, close so the client fails it instead of waiting
+                    throw SocketShutdownError(fmt::format("rpc handler failed on request {}: {}", id, e.what()));
+                }
+            });
+            return responses;
+        };
+    }
+
+    struct RpcClient::State {
+        explicit State(std::size_t max_in_flight) : max_in_flight{max_in_flight} {}
+
+        void complete(std::uint64_t id, std::vector<char> payload) {
+            std::unique_lock lock{mutex};
+            auto const request = pending.find(id);
+            if (request == pending.end()) {
+                fmt::println("dropping rpc response with unknown correlation id {}", id);
+                return;
+            }
+            auto promise = std::move(request->second);
+            pending.erase(request);
+            lock.unlock();
+            in_flight_changed.notify_one();
+            promise.set_value(std::move(payload));
+        }
+
+        void fail_pending() {
+            std::unordered_map<std::uint64_t, std::promise<std::vector<char>>> failed;
+            {
+                std::lock_guard lock{mutex};
+                closed = true;
+                failed.swap(pending);
+            }
+            in_flight_changed.notify_all();
+            for (auto &&[id, promise]: failed) {
+                promise.set_exception(std::make_exception_ptr(
+                        SocketShutdownError(fmt::format("connection closed before response to request {}", id))));
+            }
+        }
+
+        std::size_t const max_in_flight;
+        FrameDecoder decoder; // only touched by the receiving worker
+        std::mutex mutex;
+        std::condition_variable in_flight_changed;
+        std::unordered_map<std::uint64_t, std::promise<std::vector<char>>> pending;
+        std::uint64_t next_id{0};
+        bool closed{false};
+    };
+
+    RpcClient::RpcClient(std::string const &host, std::uint16_t port, std::size_t max_in_flight,
+                         BusyPollOptions const &busy_poll) :
+            m_state{std::make_shared<State>(std::max<std::size_t>(max_in_flight, 1))},
+            m_client{host, port,
+                     [state = m_state](std::vector<char> const &response) -> std::vector<char> {
+                         state->decoder.feed(response, [&](std::uint64_t id, std::vector<char> payload) {
+                             state->complete(id, std::move(payload));
+                         });
+                         return {};
+                     },
+                     busy_poll,
+                     [state = m_state]() { state->fail_pending(); }} {
+    }
+
+    std::future<std::vector<char>> RpcClient::call(std::string_view const request) {
+        return call(std::vector<char>{request.begin(), request.end()});
+    }
+
+    std::future<std::vector<char>> RpcClient::call(std::vector<char> const &request) {
+        if (!m_state) {
+            throw SocketShutdownError(fmt::format("socket not open"));
+        }
+        std::uint64_t id{0};
+        std::future<std::vector<char>> response;
+        {
+            std::unique_lock lock{m_state->mutex};
+            m_state->in_flight_changed.wait(lock, [this]() {
+                return m_state->closed || m_state->pending.size() < m_state->max_in_flight;
+            });
+            if (m_state->closed) {
+                throw SocketShutdownError(fmt::format("socket not open"));
+            }
+            id = m_state->next_id++;
+            response = m_state->pending[id].get_future();
+        }
+
+        std::vector<char> frame;
+        frame.reserve(FRAME_HEADER_SIZE + request.size());
+        try {
+            encode_frame(frame, id, request);
+            if (m_client.send(frame) != frame.size()) {
+                // the stream is out of sync with the peer from here on
+                m_client.close();
+                throw SocketError(fmt::format("could not send complete rpc frame for request {}", id));
+            }
+        } catch (...) {
+            std::lock_guard lock{m_state->mutex};
+            m_state->pending.erase(id);
+            m_state->in_flight_changed.notify_one();
+            throw;
+        }
+        return response;
+    }
+
+    std::size_t RpcClient::in_flight() const {
+        if (!m_state) {
+            return 0;
+        }
+        std::lock_guard lock{m_state->mutex};
+        return m_state->pending.size();
+    }
+
+    bool RpcClient::is_open() const {
+        return m_client.is_open();
+    }
+
+    void RpcClient::close() {
+        m_client.close();
+    }
+
+    Peer const &RpcClient::getPeer() const {
+        return m_client.getPeer();
+    }
+}
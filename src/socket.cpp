@@ -2,12 +2,23 @@
 // Created by max on 16.02.24.
 //
 #include <utility>
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include "simple_socket.hpp"
 #include <fmt/format.h>
 #include <fmt/color.h>
 
 namespace simple {
     static constexpr std::size_t DEFAULT_BUFFER_SIZE = 2048;
+    static constexpr std::size_t MAX_BUFFER_SIZE = 256 * 1024;
+    // upper bound of bytes drained per wakeup before the callback gets to run
+    static constexpr std::size_t MAX_BYTES_PER_WAKEUP = 4 * MAX_BUFFER_SIZE;
+    // consecutive wakeups using less than a quarter of the buffer before it is halved
+    static constexpr std::size_t SHRINK_AFTER_WAKEUPS = 64;
 
     static void socket_deleter(socket_t socket) {
         if (::close(socket) == -1) {
@@ -26,16 +37,84 @@ namespace simple {
 
     static socket_t initialize_and_connect(std::string const &host, std::uint16_t port);
 
-    Client::Client(socket_t socket, ReceiveCallback callback, Peer const &peer) :
-            BaseSocket(socket, true),
-            m_peer{peer},
+    // Owns the connected socket and the worker thread reading from it. Always heap allocated so the worker
+    // can safely refer to `this` while the owning Client handle is moved around.
+    class Connection {
+    public:
+        Connection(socket_t socket, Client::ReceiveCallback callback, BusyPollOptions const &busy_poll,
+                   Client::CloseCallback on_close);
+
+        Connection(Connection const &) = delete;
+        Connection &operator=(Connection const &) = delete;
+
+        ~Connection();
+
+        std::size_t send(std::vector<char> const &message);
+
+        [[nodiscard]] bool is_open() const;
+        void close();
+
+        [[nodiscard]] socket_t socket_handle() const;
+
+    private:
+        std::vector<char> receive();
+        [[nodiscard]] bool spin_until_readable() const;
+        void waiting_for_incoming_message(std::stop_token const &);
+
+        UniqueValue<socket_t, void (*)(socket_t)> m_socket;
+        std::atomic_bool m_is_open;
+        Client::ReceiveCallback m_callback;
+        Client::CloseCallback m_on_close;
+        BusyPollOptions m_busy_poll;
+        // serializes writers only, the worker is the sole reader and never waits for a sender
+        std::mutex m_send_mutex;
+        // scratch buffer reused by every receive, only reallocated when m_receive_size changes
+        std::unique_ptr<char[]> m_receive_buffer;
+        std::size_t m_receive_size{DEFAULT_BUFFER_SIZE};
+        std::size_t m_small_receives{0};
+        bool m_receive_filled{false};
+        std::jthread m_worker;
+    };
+
+    Connection::Connection(socket_t socket, Client::ReceiveCallback callback, BusyPollOptions const &busy_poll,
+                           Client::CloseCallback on_close) :
+            m_socket{socket, socket_deleter},
+            m_is_open{true},
             m_callback{std::move(callback)},
-            m_mutex() {
-        m_worker = std::jthread{std::bind_front(&Client::waiting_for_incoming_message, this)};
+            m_on_close{std::move(on_close)},
+            m_busy_poll{busy_poll},
+            m_send_mutex(),
+            m_receive_buffer{std::make_unique_for_overwrite<char[]>(DEFAULT_BUFFER_SIZE)} {
+#ifdef SO_BUSY_POLL
+        if (m_busy_poll.socket_busy_poll.count() > 0) {
+            const int usec = static_cast<int>(m_busy_poll.socket_busy_poll.count());
+            if (setsockopt(socket, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) {
+                fmt::print("could not set busy poll on socket {}: {}", socket, strerror(errno));
+            }
+        }
+#endif
+        m_worker = std::jthread{[this](std::stop_token const &stop_token) {
+            waiting_for_incoming_message(stop_token);
+            if (m_on_close) {
+                m_on_close();
+            }
+        }};
     }
 
-    Client::Client(std::string const &host, std::uint16_t port, ReceiveCallback callback)
-            : Client{initialize_and_connect(host, port), std::move(callback), Peer{host, port}} {
+    Connection::~Connection() {
+        close();
+    }
+
+    Client::Client(socket_t socket, ReceiveCallback callback, Peer const &peer, BusyPollOptions const &busy_poll,
+                   CloseCallback on_close) :
+            m_peer{peer},
+            m_connection{std::make_unique<Connection>(socket, std::move(callback), busy_poll, std::move(on_close))} {
+    }
+
+    Client::Client(std::string const &host, std::uint16_t port, ReceiveCallback callback,
+                   BusyPollOptions const &busy_poll, CloseCallback on_close)
+            : Client{initialize_and_connect(host, port), std::move(callback), Peer{host, port}, busy_poll,
+                     std::move(on_close)} {
     }
 
     Client::Client(socket_t sock, Client::ReceiveCallback const &callback) :
@@ -76,35 +155,60 @@ namespace simple {
         return sock;
     }
 
-    std::vector<char> Client::receive() const {
+    std::vector<char> Connection::receive() {
         if (!m_is_open) {
             throw SocketError(fmt::format("socket not open"));
         }
-        std::size_t read{0};
-        char tmp_buffer[DEFAULT_BUFFER_SIZE] = {0};
-        {
-            std::lock_guard lock{m_mutex};
-            read = recv(m_socket.value(), tmp_buffer, DEFAULT_BUFFER_SIZE, 0);
-        }
-        if (read == 0) {
-            throw SocketShutdownError(fmt::format("peer has shutdown connection on socket {}", m_socket.value()));
-        }
-        if (read == -1) {
-            throw SocketError(fmt::format("reading from socket failed: {}", strerror(errno)));
+        auto const resize_buffer = [this](std::size_t size) {
+            m_receive_size = size;
+            m_receive_buffer = std::make_unique_for_overwrite<char[]>(size);
+        };
+
+        // only a read that filled the buffer hints at a backlog worth asking the kernel about
+        if (int pending{0}; m_receive_filled && ::ioctl(m_socket.value(), FIONREAD, &pending) == 0 &&
+                            static_cast<std::size_t>(pending) > m_receive_size) {
+            resize_buffer(std::min(std::bit_ceil(static_cast<std::size_t>(pending)), MAX_BUFFER_SIZE));
         }
-        return std::vector<char>{tmp_buffer, tmp_buffer + read};
-    }
 
-    std::size_t Client::send(std::string_view const message) {
-        return send(std::vector<char>{message.begin(), message.end()});
-    }
+        // keep reading while recv fills the buffer, a short read means the socket is drained
+        std::vector<char> received;
+        m_receive_filled = false;
+        do {
+            auto const read = recv(m_socket.value(), m_receive_buffer.get(), m_receive_size,
+                                   received.empty() ? 0 : MSG_DONTWAIT);
+
+            if (read == 0) {
+                if (received.empty()) {
+                    throw SocketShutdownError(fmt::format("peer has shutdown connection on socket {}", m_socket.value()));
+                }
+                break; // deliver what we have, the next poll reports the shutdown
+            }
+            if (read == -1) {
+                if (received.empty() && errno != EAGAIN && errno != EWOULDBLOCK) {
+                    throw SocketError(fmt::format("reading from socket failed: {}", strerror(errno)));
+                }
+                break;
+            }
+            received.insert(received.end(), m_receive_buffer.get(), m_receive_buffer.get() + read);
+
+            m_receive_filled = static_cast<std::size_t>(read) == m_receive_size;
+            if (m_receive_filled && m_receive_size < MAX_BUFFER_SIZE) {
+                resize_buffer(m_receive_size * 2);
+            }
+        } while (m_receive_filled && received.size() < MAX_BYTES_PER_WAKEUP);
 
-    std::string Client::receive_string() const {
-        auto const received_bytes = receive();
-        return std::string{received_bytes.cbegin(), received_bytes.cend()};
+        if (received.size() < m_receive_size / 4 && m_receive_size > DEFAULT_BUFFER_SIZE) {
+            if (++m_small_receives >= SHRINK_AFTER_WAKEUPS) {
+                resize_buffer(m_receive_size / 2);
+                m_small_receives = 0;
+            }
+        } else {
+            m_small_receives = 0;
+        }
+        return received;
     }
 
-    std::size_t Client::send(std::vector<char> const &message) {
+    std::size_t Connection::send(std::vector<char> const &message) {
         if (message.empty()) { throw SocketError(fmt::format("empty send buffer")); }
         if (!m_is_open) {
             throw SocketShutdownError(fmt::format("socket not open"));
@@ -114,7 +218,7 @@ namespace simple {
         const char *send_ptr = message.data();
         auto tries = 3;
 
-        std::lock_guard lock{m_mutex};
+        std::lock_guard lock{m_send_mutex};
         while (sent_bytes < message.size() && tries > 0) {
             std::size_t sent = 0;
             if (sent = ::send(m_socket.value(), send_ptr + sent_bytes, message.size() - sent_bytes, 0); sent == -1) {
@@ -126,12 +230,35 @@ namespace simple {
         return sent_bytes;
     }
 
-    void Client::waiting_for_incoming_message(std::stop_token const &stop_token) {
+    bool Connection::spin_until_readable() const {
+        auto const deadline = std::chrono::steady_clock::now() + m_busy_poll.spin_budget;
+        char probe{0};
+        do {
+            // data, an orderly shutdown and hard errors are all left for receive() to report
+            if (recv(m_socket.value(), &probe, 1, MSG_PEEK | MSG_DONTWAIT) != -1 ||
+                (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                return true;
+            }
+        } while (m_is_open && std::chrono::steady_clock::now() < deadline);
+        return false;
+    }
+
+    void Connection::waiting_for_incoming_message(std::stop_token const &stop_token) {
         if (!m_callback) {
             fmt::print("empty callback shutting down");
             return;
         }
 
+        if (m_busy_poll.cpu_core.has_value()) {
+            cpu_set_t cpu_set;
+            CPU_ZERO(&cpu_set);
+            CPU_SET(m_busy_poll.cpu_core.value(), &cpu_set);
+            if (const auto ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set); ret != 0) {
+                fmt::print("could not pin worker of socket {} to core {}: {}", m_socket.value(),
+                           m_busy_poll.cpu_core.value(), strerror(ret));
+            }
+        }
+
         pollfd fds[1];
         fds[0].fd = m_socket.value();
         fds[0].events = POLLIN;
@@ -142,7 +269,9 @@ namespace simple {
                 return;
             }
             auto result = 0;
-            if (result = poll(fds, 1, 10);result == -1) {
+            if (m_busy_poll.spin_budget.count() > 0 && spin_until_readable()) {
+                result = 1;
+            } else if (result = poll(fds, 1, 10);result == -1) {
                 fmt::print(fg(fmt::color::crimson) | fmt::emphasis::bold, "poll error: {}", strerror(errno));
                 return;
             } else if (result == 0) {
@@ -157,6 +286,8 @@ namespace simple {
                 } catch (SocketShutdownError const &e) {
                     fmt::println("{}", e.what());
                     m_is_open = false;
+                    // let the peer see fatal errors raised by the callback as well
+                    ::shutdown(m_socket.value(), SHUT_RDWR);
                     return;
                 } catch (SocketError const &e) {
                     fmt::println("communication error on socket {}: {}", m_socket.value(), e.what());
@@ -168,47 +299,54 @@ namespace simple {
         fmt::println("thread shutting down");
     }
 
-    // https://stackoverflow.com/questions/29986208/how-should-i-deal-with-mutexes-in-movable-types-in-c
-    Client::Client(Client &&other) noexcept: BaseSocket(other.m_socket.value(), [](socket_t) {}) {
-        {
-            std::unique_lock lock{other.m_mutex};
-            m_is_open = other.m_is_open;
-            m_callback = std::move(other.m_callback);
-            m_socket = std::move(other.m_socket);
-            m_worker = std::jthread(std::bind_front(&Client::waiting_for_incoming_message, this));
-        }
-        other.close();
+    bool Connection::is_open() const {
+        return m_is_open;
     }
 
-    Client &Client::operator=(Client &&other) noexcept {
-        if (this != std::addressof(other)) {
-            {
-                std::unique_lock lock{other.m_mutex};
-                m_is_open = other.m_is_open;
-                m_callback = std::move(other.m_callback);
-                m_socket = std::move(other.m_socket);
-                m_worker = std::jthread(std::bind_front(&Client::waiting_for_incoming_message, this));
-            }
-            other.close();
+    void Connection::close() {
+        m_is_open = false;
+        m_worker.request_stop();
+        if (m_worker.joinable() && m_worker.get_id() != std::this_thread::get_id()) {
+            m_worker.join();
         }
-        return *this;
     }
 
-    Client::~Client() {
-        close();
+    socket_t Connection::socket_handle() const {
+        return m_socket.value();
     }
 
+    std::size_t Client::send(std::string_view const message) {
+        return send(std::vector<char>{message.begin(), message.end()});
+    }
+
+    std::size_t Client::send(std::vector<char> const &message) {
+        if (!m_connection) {
+            throw SocketShutdownError(fmt::format("socket not open"));
+        }
+        return m_connection->send(message);
+    }
+
+    Client::Client(Client &&other) noexcept = default;
+
+    Client &Client::operator=(Client &&other) noexcept = default;
+
+    Client::~Client() = default;
+
     bool Client::is_open() const {
-        return m_is_open;
+        return m_connection && m_connection->is_open();
     }
 
     void Client::close() {
-        std::unique_lock lock{m_mutex};
-        m_is_open = false;
-        m_worker.request_stop();
-        if (m_worker.joinable()) {
-            m_worker.join();
+        if (m_connection) {
+            m_connection->close();
+        }
+    }
+
+    std::optional<socket_t> Client::socket_handle() const {
+        if (m_connection) {
+            return m_connection->socket_handle();
         }
+        return std::nullopt;
     }
 
     Peer const &Client::getPeer() const {
@@ -275,7 +413,7 @@ namespace simple {
         return m_is_open;
     }
 
-    Client ServerSocket::accept(Client::ReceiveCallback const& callback) {
+    Client ServerSocket::accept(Client::ReceiveCallback const& callback, BusyPollOptions const &busy_poll) {
         if(!m_is_open) {
             throw SocketError(fmt::format("socket not open {}\n", m_socket.value()));
         }
@@ -297,7 +435,7 @@ namespace simple {
         if (clientSocket == -1) {
             throw SocketError(fmt::format("could not accept incoming connection on socket {}: {}\n", m_socket.value(), strerror(errno)));
         }
-        return Client{clientSocket, callback, Peer{inet_ntoa(client.sin_addr),ntohs(client.sin_port)}};
+        return Client{clientSocket, callback, Peer{inet_ntoa(client.sin_addr),ntohs(client.sin_port)}, busy_poll};
     }
 
     void ServerSocket::close() {
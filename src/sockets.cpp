@@ -18,8 +18,13 @@ namespace simple {
     }
 
     Client Sockets::create_client(std::string const &host, std::uint16_t port, Client::ReceiveCallback callback,
-                                  Sockets const &) {
-        return Client{host, port, std::move(callback)};
+                                  BusyPollOptions const &busy_poll, Sockets const &) {
+        return Client{host, port, std::move(callback), busy_poll};
+    }
+
+    RpcClient Sockets::create_rpc_client(std::string const &host, std::uint16_t port, std::size_t max_in_flight,
+                                         BusyPollOptions const &busy_poll, Sockets const &) {
+        return RpcClient{host, port, max_in_flight, busy_poll};
     }
 
     ServerSocket